@@ -0,0 +1,147 @@
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <string>
+
+#include "journal.h"
+#include "order_book.h"
+
+using trading::Journal;
+using trading::Order;
+using trading::OrderBook;
+using trading::OrderType;
+using trading::Side;
+using Clock = std::chrono::steady_clock;
+
+static constexpr std::size_t kOps    = 1'000'000;
+static constexpr std::size_t kLevels = 64;
+
+static inline std::uint64_t ns_between(Clock::time_point a, Clock::time_point b) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(b - a).count();
+}
+
+// Rest `kLevels` ask levels of 100 shares each, starting at 100.0000.
+static void seed_asks(OrderBook &book, std::uint64_t &id) {
+    for (std::size_t lvl = 0; lvl < kLevels; ++lvl)
+        book.add_order(Order{id++, Side::Ask, static_cast<trading::price4_t>(1'000'000 + lvl * 100), 100, id});
+}
+
+// Each op is timed as a whole; `op` receives a fresh order id and is responsible for keeping
+// the book in a steady state (re-seeding liquidity it consumes, etc).
+static void run_case(const std::string &name, const std::function<void(OrderBook &, std::uint64_t &)> &op) {
+    OrderBook book;
+    std::uint64_t id = 1;
+    seed_asks(book, id);
+
+    auto t0 = Clock::now();
+    for (std::size_t i = 0; i < kOps; ++i)
+        op(book, id);
+    auto t1 = Clock::now();
+
+    const double ns_per_op = static_cast<double>(ns_between(t0, t1)) / kOps;
+    std::cout << std::left << std::setw(34) << name
+              << std::right << std::setw(10) << ns_per_op << " ns/op  "
+              << std::setw(14) << (1e9 / ns_per_op) << " ops/s\n";
+}
+
+// Mixed inbound flow through the public API: rest, shrink, trade, cancel. No options = no journal.
+static void run_journal_case(const std::string &name, const std::optional<Journal::Options> &options) {
+    const auto path = (std::filesystem::temp_directory_path() / "order_book_bench.journal").string();
+    std::filesystem::remove(path);
+
+    // Attach before seeding: a journal only takes a fresh book. The seed is journaled but untimed.
+    OrderBook book;
+    std::optional<Journal> journal;
+    if (options) {
+        journal.emplace(path, *options);
+        book.attach_journal(&*journal);
+    }
+
+    std::uint64_t id = 1;
+    seed_asks(book, id);
+    if (journal)
+        journal->commit();
+
+    auto t0 = Clock::now();
+    for (std::size_t i = 0; i < kOps / 4; ++i) {
+        const auto bid = id++;
+        book.add_order(Order{bid, Side::Bid, 990'000, 100, bid});
+        book.decrease_qty(bid, 40);
+        const auto ask = id++;
+        book.add_order(Order{ask, Side::Ask, 990'000, 30, ask, OrderType::IOC});
+        book.cancel_order(bid);
+    }
+    if (journal)
+        journal->commit();   // count the final group commit
+    auto t1 = Clock::now();
+
+    book.attach_journal(nullptr);
+    journal.reset();
+    std::filesystem::remove(path);
+
+    const double sec = static_cast<double>(ns_between(t0, t1)) / 1e9;
+    std::cout << std::left << std::setw(34) << name
+              << std::right << std::setw(10) << (sec * 1e9 / kOps) << " ns/op  "
+              << std::setw(14) << (kOps / sec) << " cmds/s\n";
+}
+
+int main() {
+    std::cout << std::fixed << std::setprecision(2);
+
+    // Non-crossing bid: IOC emulated by the gateway as add + cancel.
+    run_case("limit add+cancel (emulated IOC)", [](OrderBook &book, std::uint64_t &id) {
+        const auto oid = id++;
+        book.add_order(Order{oid, Side::Bid, 990'000, 100, oid});
+        book.cancel_order(oid);
+    });
+
+    // Same flow with a native IOC: no insert, no index entry, no lookup.
+    run_case("native IOC (no cross)", [](OrderBook &book, std::uint64_t &id) {
+        const auto oid = id++;
+        book.add_order(Order{oid, Side::Bid, 990'000, 100, oid, OrderType::IOC});
+    });
+
+    // IOC that takes the top level and leaves a dropped residual; replenish the level.
+    run_case("native IOC (partial fill)", [](OrderBook &book, std::uint64_t &id) {
+        const auto oid = id++;
+        book.add_order(Order{oid, Side::Bid, 1'000'000, 150, oid, OrderType::IOC});
+        book.add_order(Order{id, Side::Ask, 1'000'000, 100, id});
+        ++id;
+    });
+
+    // FOK that walks two levels; replenish both.
+    run_case("FOK (filled, 2 levels)", [](OrderBook &book, std::uint64_t &id) {
+        const auto oid = id++;
+        book.add_order(Order{oid, Side::Bid, 1'000'100, 200, oid, OrderType::FOK});
+        book.add_order(Order{id, Side::Ask, 1'000'000, 100, id});
+        ++id;
+        book.add_order(Order{id, Side::Ask, 1'000'100, 100, id});
+        ++id;
+    });
+
+    // FOK rejected by the liquidity pre-check: the book is never mutated.
+    run_case("FOK (rejected pre-check)", [](OrderBook &book, std::uint64_t &id) {
+        const auto oid = id++;
+        book.add_order(Order{oid, Side::Bid, 1'000'100, 300, oid, OrderType::FOK});
+    });
+
+    // Market order sweeping the top level; replenish it.
+    run_case("market (1 level)", [](OrderBook &book, std::uint64_t &id) {
+        const auto oid = id++;
+        book.add_order(Order{oid, Side::Bid, 0, 100, oid, OrderType::Market});
+        book.add_order(Order{id, Side::Ask, 1'000'000, 100, id});
+        ++id;
+    });
+
+    std::cout << '\n';
+    run_journal_case("journal off", std::nullopt);
+    run_journal_case("journal on (fsync per 1024)", Journal::Options{});
+    run_journal_case("journal on (fsync per 64)", Journal::Options{.batch_records = 64});
+    run_journal_case("journal on (no fsync)", Journal::Options{.fsync = false});
+
+    return 0;
+}
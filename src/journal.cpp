@@ -0,0 +1,229 @@
+#include "journal.h"
+
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <system_error>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "order_book.h"
+
+namespace trading {
+    static constexpr char kMagic[8] = {'O', 'B', 'J', 'R', 'N', 'L', '0', '1'};
+
+    static std::uint32_t checksum(const JournalRecord &rec) {
+        const auto *p = reinterpret_cast<const unsigned char *>(&rec);
+        std::uint32_t h = 2166136261u;
+        for (std::size_t i = 0; i < offsetof(JournalRecord, checksum); ++i) {
+            h ^= p[i];
+            h *= 16777619u;
+        }
+        return h;
+    }
+
+    static bool write_all(int fd, const void *data, std::size_t size) {
+        const auto *p = static_cast<const char *>(data);
+        while (size > 0) {
+            const ssize_t n = ::write(fd, p, size);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                return false;
+            }
+            p += n;
+            size -= static_cast<std::size_t>(n);
+        }
+        return true;
+    }
+
+    // Like ::read, but retries until `size` bytes or EOF. Returns bytes read or -1.
+    static ssize_t read_all(int fd, void *data, std::size_t size) {
+        auto *p = static_cast<char *>(data);
+        std::size_t done = 0;
+        while (done < size) {
+            const ssize_t n = ::read(fd, p + done, size - done);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                return -1;
+            }
+            if (n == 0)
+                break;
+            done += static_cast<std::size_t>(n);
+        }
+        return static_cast<ssize_t>(done);
+    }
+
+    Journal::Journal(const std::string &path) : Journal(path, Options{}) {
+    }
+
+    Journal::Journal(const std::string &path, Options options)
+        : fd_(::open(path.c_str(), O_RDWR | O_CREAT, 0644)),
+          options_(options) {
+        if (fd_ < 0)
+            throw std::system_error(errno, std::generic_category(), "open journal " + path);
+
+        try {
+            recover_tail(path);
+        } catch (...) {
+            ::close(fd_);
+            throw;
+        }
+
+        active_.reserve(options_.batch_records);
+        pending_.reserve(options_.batch_records);
+        flusher_ = std::thread([this] { flush_loop(); });
+    }
+
+    void Journal::recover_tail(const std::string &path) {
+        auto fail = [&path](const char *what) {
+            throw std::system_error(errno, std::generic_category(), what + path);
+        };
+
+        char magic[sizeof(kMagic)];
+        const ssize_t got = read_all(fd_, magic, sizeof(magic));
+        if (got < 0)
+            fail("read journal header ");
+
+        if (got < static_cast<ssize_t>(sizeof(kMagic))) {
+            // New file, or a crash while the header itself was being written.
+            if (std::memcmp(magic, kMagic, static_cast<std::size_t>(got)) != 0)
+                throw std::system_error(std::make_error_code(std::errc::invalid_argument), "not a journal " + path);
+            if (::ftruncate(fd_, 0) != 0 || ::lseek(fd_, 0, SEEK_SET) < 0 || !write_all(fd_, kMagic, sizeof(kMagic)))
+                fail("write journal header ");
+            return;
+        }
+        if (std::memcmp(magic, kMagic, sizeof(kMagic)) != 0)
+            throw std::system_error(std::make_error_code(std::errc::invalid_argument), "not a journal " + path);
+
+        // Keep the intact prefix (what `replay` would apply) and drop any torn or corrupt tail,
+        // so records appended from here on start on a record boundary.
+        off_t valid = sizeof(kMagic);
+        std::vector<JournalRecord> chunk(4096);
+        for (bool intact = true; intact;) {
+            const ssize_t n = read_all(fd_, chunk.data(), chunk.size() * sizeof(JournalRecord));
+            if (n < 0)
+                fail("read journal ");
+
+            const std::size_t whole = static_cast<std::size_t>(n) / sizeof(JournalRecord);
+            std::size_t ok = 0;
+            while (ok < whole && chunk[ok].checksum == checksum(chunk[ok]))
+                ++ok;
+            valid += static_cast<off_t>(ok * sizeof(JournalRecord));
+            intact = ok == chunk.size();
+        }
+
+        if (::ftruncate(fd_, valid) != 0 || ::lseek(fd_, valid, SEEK_SET) < 0)
+            fail("truncate journal ");
+    }
+
+    Journal::~Journal() {
+        try {
+            commit();
+        } catch (const std::system_error &) {
+            // Nothing sensible to do in a destructor; the error was already sticky.
+        }
+        {
+            std::lock_guard lk(mtx_);
+            stop_ = true;
+        }
+        cv_.notify_all();
+        flusher_.join();
+        ::close(fd_);
+    }
+
+    void Journal::append(JournalRecord record) {
+        record.checksum = checksum(record);
+
+        std::unique_lock lk(mtx_);
+        const bool fills = active_.size() + 1 >= options_.batch_records;
+        if (fills)
+            cv_.wait(lk, [this] { return !pending_full_; });   // back-pressure: previous batch still in flight
+        if (error_ != 0)
+            throw std::system_error(error_, std::generic_category(), "journal write");
+
+        ++appended_;
+        const bool first = active_.empty();
+        if (first)
+            oldest_ = std::chrono::steady_clock::now();
+        active_.push_back(record);
+
+        if (fills)
+            hand_off();
+        else if (first && options_.max_delay.count() > 0)
+            cv_.notify_all();   // arm the flusher's max-delay deadline
+    }
+
+    void Journal::hand_off() {
+        active_.swap(pending_);
+        pending_full_ = true;
+        cv_.notify_all();
+    }
+
+    void Journal::commit() {
+        std::unique_lock lk(mtx_);
+        cv_.wait(lk, [this] { return !pending_full_; });
+        if (!active_.empty()) {
+            hand_off();
+            cv_.wait(lk, [this] { return !pending_full_; });
+        }
+        if (error_ != 0)
+            throw std::system_error(error_, std::generic_category(), "journal write");
+    }
+
+    void Journal::flush_loop() {
+        const bool timed = options_.max_delay.count() > 0;
+
+        std::unique_lock lk(mtx_);
+        for (;;) {
+            if (!pending_full_) {
+                if (stop_)
+                    return;   // the destructor committed everything before stopping us
+
+                if (!timed || active_.empty()) {
+                    cv_.wait(lk, [&] { return pending_full_ || stop_ || (timed && !active_.empty()); });
+                } else if (!cv_.wait_until(lk, oldest_ + options_.max_delay,
+                                           [this] { return pending_full_ || stop_; })) {
+                    // The oldest record reached its max delay: take the partial batch.
+                    active_.swap(pending_);
+                    pending_full_ = true;
+                }
+                continue;
+            }
+
+            lk.unlock();
+            int err = 0;
+            if (!write_all(fd_, pending_.data(), pending_.size() * sizeof(JournalRecord)))
+                err = errno;
+            else if (options_.fsync && ::fsync(fd_) != 0)
+                err = errno;
+            pending_.clear();
+            lk.lock();
+
+            if (err != 0 && error_ == 0)
+                error_ = err;
+            pending_full_ = false;
+            cv_.notify_all();
+        }
+    }
+
+    std::size_t Journal::replay(const std::string &path, OrderBook &book, std::vector<Trade> *trades) {
+        std::ifstream in(path, std::ios::binary);
+        char magic[sizeof(kMagic)];
+        if (!in.read(magic, sizeof(magic)) || std::memcmp(magic, kMagic, sizeof(kMagic)) != 0)
+            return 0;
+
+        std::size_t applied = 0;
+        JournalRecord rec;
+        while (in.read(reinterpret_cast<char *>(&rec), sizeof(rec))) {
+            if (rec.checksum != checksum(rec))
+                break;
+
+            auto generated = book.apply(rec);
+            if (trades)
+                trades->insert(trades->end(), generated.begin(), generated.end());
+            ++applied;
+        }
+        return applied;
+    }
+} // namespace trading
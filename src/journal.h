@@ -0,0 +1,110 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "types.h"
+
+namespace trading {
+
+class OrderBook;
+struct Trade;
+
+/// Inbound command kinds recorded in the journal.
+enum class Command : std::uint8_t { Add, Cancel, Modify, Decrease, Clear };
+
+/// One journaled command, fixed-size and written verbatim.
+/// `ts` is the engine time the command was applied at; replay feeds it back so trade timestamps
+/// and re-stamped orders come out identical.
+struct JournalRecord {
+    order_id_t    id;
+    ts_ns_t       ts;          ///< Engine time of the command
+    ts_ns_t       order_ts;    ///< Add: client order timestamp
+    price4_t      price;       ///< Add: limit; Modify: new price if `has_price`
+    qty_t         qty;         ///< Add: quantity; Modify: new qty if `has_qty`; Decrease: delta
+    Command       command;
+    Side          side;        ///< Add only
+    OrderType     type;        ///< Add only
+    std::uint8_t  flags;       ///< Modify: has_price / has_qty bits
+    std::uint32_t checksum;    ///< FNV-1a over the preceding bytes; detects a torn tail
+
+    static constexpr std::uint8_t has_price = 1u << 0;
+    static constexpr std::uint8_t has_qty   = 1u << 1;
+};
+static_assert(sizeof(JournalRecord) == 40, "journal record layout is part of the file format");
+
+// --- Journal ---------------------------------------------------------------------------------
+/// Append-only write-ahead journal with group commit.
+/// `append` only copies the record into the active batch. A background flusher writes a batch
+/// and fsyncs once for all of it, either when it fills or when its oldest record has waited
+/// `max_delay`, so the hot path only waits if the disk falls a full batch behind. A crash loses
+/// at most the records appended within `max_delay` plus one batch write/fsync before it (with
+/// `max_delay` = 0, up to a whole unfilled batch). `commit` forces the current batch out and
+/// waits until it is durable.
+class Journal {
+public:
+    struct Options {
+        std::size_t               batch_records = 1024;   ///< Records per group commit
+        std::chrono::milliseconds max_delay{5};           ///< Max age of an unwritten record; 0 = size only
+        bool                      fsync         = true;   ///< fsync after each batch write
+    };
+
+    /// Open (or create) `path` for appending. A torn or corrupt tail left by a crash is cut off
+    /// first, so the file keeps exactly the records `replay` applies. Throws std::system_error
+    /// on failure or if `path` is not a journal.
+    explicit Journal(const std::string& path);
+    Journal(const std::string& path, Options options);
+    ~Journal();
+
+    Journal(const Journal&) = delete;
+    Journal& operator=(const Journal&) = delete;
+
+    /// Add a record to the active batch. Throws std::system_error once a batch write or fsync
+    /// has failed, so a dead journal stops the engine instead of silently dropping commands.
+    void append(JournalRecord record);
+
+    /// Flush the active batch and block until everything appended so far is durable.
+    /// Throws std::system_error if the flusher hit an I/O error.
+    void commit();
+
+    std::uint64_t appended() const { return appended_; }
+
+    /// False once a batch write or fsync has failed; the journal accepts nothing after that.
+    bool healthy() const {
+        std::lock_guard lk(mtx_);
+        return error_ == 0;
+    }
+
+    /// Re-apply every intact record of `path` to `book` in order. Trades generated by the
+    /// replay are appended to `trades` if given. Returns the number of records applied;
+    /// reading stops at the first truncated or corrupt record.
+    static std::size_t replay(const std::string& path, OrderBook& book,
+                              std::vector<Trade>* trades = nullptr);
+
+private:
+    void recover_tail(const std::string& path);
+    void hand_off();   // mtx_ held, !pending_full_
+    void flush_loop();
+
+    int     fd_;
+    Options options_;
+
+    std::uint64_t appended_ = 0;           ///< Engine thread only
+
+    mutable std::mutex      mtx_;
+    std::condition_variable cv_;
+    std::vector<JournalRecord> active_;    ///< Filled by `append`; taken by the flusher on timeout
+    std::vector<JournalRecord> pending_;   ///< Owned by the flusher while `pending_full_`
+    std::chrono::steady_clock::time_point oldest_;   ///< When the first record entered `active_`
+    bool pending_full_ = false;
+    bool stop_         = false;
+    int  error_        = 0;                ///< errno of the first failed write/fsync
+    std::thread flusher_;
+};
+
+} // namespace trading
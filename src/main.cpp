@@ -1,9 +1,12 @@
 #include <fstream>
 #include <iostream>
 #include <cstdint>
+#include <algorithm>
 #include <unordered_set>
 #include <chrono>
+#include <charconv>
 #include <iomanip>
+#include <string_view>
 
 #include "order_book.h"
 #include "transcoder/transcoder.hpp"
@@ -35,10 +38,41 @@ static inline std::string trim_stock(const std::array<char, 8> &raw) {
     return s;
 }
 
-int main() {
+// Peak resting orders across the whole NASDAQ universe is a few million; pre-size for it so
+// the index never rehashes mid-run.
+static constexpr std::size_t kUniverseOrders = std::size_t{1} << 22;
+
+int main(int argc, char **argv) {
+    // Every `checksum_every` messages, write "<msg#> <locate> <state_hash>" for each book whose
+    // hash changed since its last line (locate order). Diffing the files of two engine runs
+    // pinpoints the first divergent book and message window. 0 disables.
+    //   main [--checksum-every N] [--checksum-path FILE]
+    std::size_t checksum_every = 0;
+    std::string checksum_path = "book_checksums.txt";
+    for (int i = 1; i < argc; ++i) {
+        const std::string_view arg = argv[i];
+        if (arg == "--checksum-every" && i + 1 < argc) {
+            const std::string_view val = argv[++i];
+            auto [end, ec] = std::from_chars(val.data(), val.data() + val.size(), checksum_every);
+            if (ec != std::errc{} || end != val.data() + val.size()) {
+                std::cerr << "Invalid --checksum-every value: " << val << '\n';
+                return 1;
+            }
+        } else if (arg == "--checksum-path" && i + 1 < argc) {
+            checksum_path = argv[++i];
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [--checksum-every N] [--checksum-path FILE]\n";
+            return 1;
+        }
+    }
+
+    // Empty watch list = full-universe mode: a book for every stock_directory entry.
+    std::unordered_set<std::string> watch = {"AAPL", "AMZN"};
+
+    // All books share one order pool and id index; declared first so it outlives them.
+    trading::OrderStore store(watch.empty() ? kUniverseOrders : 0);
     BookMap books;
     std::unordered_map<Locate, std::string> symbols;
-    std::unordered_set<std::string> watch = {"AAPL", "AMZN"};
 
     std::ifstream file("/Users/danil/Downloads/12302019.NASDAQ_ITCH50",
                        std::ios::binary);
@@ -47,12 +81,38 @@ int main() {
         return 1;
     }
 
+    std::ofstream checksums;
+    if (checksum_every) {
+        checksums.open(checksum_path);
+        if (!checksums) {
+            std::cerr << "Failed to open " << checksum_path << '\n';
+            return 1;
+        }
+    }
+    // Books the router handed a message since the last emit; only those can have a new hash.
+    std::vector<std::uint64_t> last_hash(std::size_t{1} << 16);
+    std::vector<bool> is_touched(std::size_t{1} << 16);
+    std::vector<std::pair<Locate, const trading::OrderBook *>> touched;
+
     std::vector<char> msg_buf;
 
     std::size_t msg_count = 0;
     std::size_t bytes_read = 0;
     std::uint64_t io_ns = 0, decode_ns = 0, route_ns = 0, book_ns = 0;
 
+    auto emit_checksums = [&] {
+        std::sort(touched.begin(), touched.end());
+        for (auto [loc, book]: touched) {
+            const std::uint64_t h = book->state_hash();
+            if (h != last_hash[loc]) {
+                checksums << std::dec << msg_count << ' ' << loc << ' ' << std::hex << h << '\n';
+                last_hash[loc] = h;
+            }
+            is_touched[loc] = false;
+        }
+        touched.clear();
+    };
+
     auto t_run0 = Clock::now();
 
     for (;;) {
@@ -98,7 +158,7 @@ int main() {
                     std::string stock = trim_stock(m.stock);
                     if (watch.empty() || watch.contains(stock)) {
                         symbols[m.stock_locate] = stock;
-                        books.try_emplace(m.stock_locate);
+                        books.try_emplace(m.stock_locate, store);
                     }
                     return;
                 }
@@ -112,15 +172,22 @@ int main() {
 
                 if constexpr (requires { m.stock_locate; }) {
                     auto it = books.find(m.stock_locate);
-                    if (it == books.end()) return; {
+                    if (it == books.end()) return;
+                    if (checksum_every && !is_touched[m.stock_locate]) {
+                        is_touched[m.stock_locate] = true;
+                        touched.emplace_back(m.stock_locate, &it->second);
+                    }
+                    {
                         ScopeTimer tb(book_ns);
                         itch_router::handle(m, it->second);
                     }
                 }
             }, msg);
         }
+        if (checksum_every && msg_count % checksum_every == 0) emit_checksums();
         if (stop) {break;}
     }
+    if (checksum_every) emit_checksums();
 
     auto t_run1 = Clock::now();
     double sec = ns_between(t_run0, t_run1) / 1e9;
@@ -136,10 +203,16 @@ int main() {
             << "Route " << route_ns / 1e6 << " ms (" << pct(route_ns) << "%), "
             << "Book " << book_ns / 1e6 << " ms (" << pct(book_ns) << "%)\n";
 
+    // Shared pool/index are counted once; books add only their own ladders.
+    trading::MemoryUsage total = store.memory_usage();
     for (const auto &[loc, book]: books) {
         std::cout << (symbols.count(loc) ? symbols[loc] : std::to_string(loc)) << '\n';
         trading::print_order_book(book);
+        trading::print_memory_usage(book.memory_usage());
+        total.levels += book.memory_usage().levels;
     }
+    std::cout << "Total (" << books.size() << " books, " << store.size() << " resting orders) ";
+    trading::print_memory_usage(total);
     std::cout << std::endl;
 
     return 0;
@@ -1,6 +1,9 @@
 #include "order_book.h"
+#include "journal.h"
+#include <algorithm>
 #include <chrono>
-#include <numeric>
+#include <limits>
+#include <stdexcept>
 
 namespace trading {
     static ts_ns_t now_ns() {
@@ -8,262 +11,407 @@ namespace trading {
         return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
     }
 
+    // splitmix64 finaliser: cheap, well-distributed 64-bit mixing.
+    static std::uint64_t mix(std::uint64_t x) {
+        x ^= x >> 30;
+        x *= 0xbf58476d1ce4e5b9ULL;
+        x ^= x >> 27;
+        x *= 0x94d049bb133111ebULL;
+        x ^= x >> 31;
+        return x;
+    }
+
+    // Terms of the additive state hash. Summing makes the hash independent of mutation order;
+    // distinct tags keep order and level terms from cancelling each other. An order's FIFO
+    // priority is encoded by the id of the order ahead of it in its level, so the hash depends
+    // only on the current queue, not on how it was built.
+    static constexpr std::uint64_t kHeadOfLevel = 0x8f1bbcdcca62c1d6ULL;
+
+    static std::uint64_t level_term(Side side, price4_t price, qty_t total) {
+        return mix(0x9e3779b97f4a7c15ULL ^ mix((std::uint64_t{price} << 32 | total)
+                                               ^ static_cast<std::uint8_t>(side)));
+    }
+
+    std::uint64_t OrderBook::order_term(handle_t h) const {
+        const OrderNode &node = (*store_)[h];
+        const std::uint64_t ahead = (node.prev != OrderStore::npos) ? mix((*store_)[node.prev].id) : kHeadOfLevel;
+        return mix(node.id ^ mix((std::uint64_t{node.price} << 32 | node.quantity)
+                                 ^ mix(ahead ^ static_cast<std::uint8_t>(node.side))));
+    }
+
+    OrderBook::OrderBook()
+        : own_store_(std::make_unique<OrderStore>()),
+          store_(own_store_.get()),
+          book_id_(store_->register_book()) {
+    }
+
+    OrderBook::OrderBook(OrderStore &store)
+        : store_(&store),
+          book_id_(store_->register_book()) {
+    }
+
+    OrderBook::~OrderBook() {
+        // A private store goes away with the book; a shared one must get its nodes back.
+        if (!own_store_)
+            do_clear();
+    }
+
+    void OrderBook::attach_journal(Journal *journal) {
+        // Replay starts from an empty book: state built by unjournaled commands would be missing.
+        if (journal && unjournaled_ && (live_orders_ != 0 || next_trade_id_ != 1))
+            throw std::logic_error("OrderBook: attach a journal before the first command");
+        journal_ = journal;
+    }
+
+    void OrderBook::record(JournalRecord rec) {
+        rec.ts = now_ = now_ns();
+        journal_->append(rec);
+    }
+
+    ts_ns_t OrderBook::engine_time() {
+        // Without a journal the clock is only read if the command actually needs a timestamp.
+        if (now_ == 0)
+            now_ = now_ns();
+        return now_;
+    }
+
     std::vector<Trade> OrderBook::add_order(const Order &order) {
-        std::vector<Trade> trades;
+        now_ = 0;
+        if (journal_) {
+            JournalRecord rec{};
+            rec.command = Command::Add;
+            rec.id = order.id;
+            rec.order_ts = order.timestamp;
+            rec.price = order.price;
+            rec.qty = order.quantity;
+            rec.side = order.side;
+            rec.type = order.type;
+            record(rec);
+        } else {
+            unjournaled_ = true;
+        }
+        return do_add(order);
+    }
 
-        if (index_.contains(order.id)) {
-            return trades;
+    bool OrderBook::cancel_order(std::uint64_t order_id) {
+        now_ = 0;
+        if (journal_) {
+            JournalRecord rec{};
+            rec.command = Command::Cancel;
+            rec.id = order_id;
+            record(rec);
+        } else {
+            unjournaled_ = true;
         }
+        return do_cancel(order_id);
+    }
 
-        if (order.side == Side::Bid) {
-            bool cross = !asks_.empty() && asks_.begin()->first <= order.price;
-            qty_t rest = order.quantity;
-
-            if (cross) {
-                for (auto it = asks_.begin(); it != asks_.end() && rest > 0;) {
-                    auto &[price, fifo] = it->second; // PriceLevel (price4_t, deque<Order>)
-
-                    while (!fifo.empty()) {
-                        if (fifo.front().quantity < rest) {
-                            rest -= fifo.front().quantity;
-                            Trade tr{
-                                next_trade_id_++,
-                                fifo.front().id,
-                                order.id,
-                                order.side,
-                                fifo.front().price,
-                                fifo.front().quantity,
-                                now_ns()
-                            };
-                            trades.push_back(tr);
-                            index_.erase(fifo.front().id);
-                            fifo.pop_front();
-                        } else {
-                            fifo.front().quantity -= rest;
-                            Trade tr{
-                                next_trade_id_++,
-                                fifo.front().id,
-                                order.id,
-                                order.side,
-                                fifo.front().price,
-                                rest,
-                                now_ns()
-                            };
-                            trades.push_back(tr);
-                            rest = 0;
-                            if (fifo.front().quantity == 0) {
-                                index_.erase(fifo.front().id);
-                                fifo.pop_front();
-                            }
-                            break;
-                        }
-                    }
-
-                    if (fifo.empty()) {
-                        it = asks_.erase(it);
-                    } else {
-                        ++it;
-                    }
-
-                    if (rest == 0) {
-                        return trades;
-                    }
-                }
-            }
+    bool OrderBook::modify_order(std::uint64_t order_id,
+                                 std::optional<price4_t> new_price,
+                                 std::optional<qty_t> new_qty) {
+        now_ = 0;
+        if (journal_) {
+            JournalRecord rec{};
+            rec.command = Command::Modify;
+            rec.id = order_id;
+            rec.price = new_price.value_or(0);
+            rec.qty = new_qty.value_or(0);
+            rec.flags = (new_price ? JournalRecord::has_price : 0) | (new_qty ? JournalRecord::has_qty : 0);
+            record(rec);
+        } else {
+            unjournaled_ = true;
+        }
+        return do_modify(order_id, new_price, new_qty);
+    }
 
-            auto [lvlIt, _] = bids_.try_emplace(order.price, PriceLevel{order.price});
-            lvlIt->second.fifo.emplace_back(Order{order.id, Side::Bid, order.price, rest, order.timestamp});
-            const auto &fifo = lvlIt->second.fifo;
-            const std::size_t offset = fifo.size() - 1;
-            index_[order.id] = {order.side, rest, order.price, offset};
+    bool OrderBook::decrease_qty(order_id_t order_id, qty_t delta) {
+        now_ = 0;
+        if (journal_) {
+            JournalRecord rec{};
+            rec.command = Command::Decrease;
+            rec.id = order_id;
+            rec.qty = delta;
+            record(rec);
+        } else {
+            unjournaled_ = true;
         }
+        return do_decrease(order_id, delta);
+    }
 
-        if (order.side == Side::Ask) {
-            bool cross = !bids_.empty() && bids_.begin()->first >= order.price;
-            qty_t rest = order.quantity;
-
-            if (cross) {
-                for (auto it = bids_.begin(); it != bids_.end() && rest > 0;) {
-                    auto &[price, fifo] = it->second;
-
-                    while (!fifo.empty()) {
-                        if (fifo.front().quantity < rest) {
-                            rest -= fifo.front().quantity;
-                            Trade tr{
-                                next_trade_id_++,
-                                fifo.front().id,
-                                order.id,
-                                order.side,
-                                fifo.front().price,
-                                fifo.front().quantity,
-                                now_ns()
-                            };
-                            trades.push_back(tr);
-                            index_.erase(fifo.front().id);
-                            fifo.pop_front();
-                        } else {
-                            fifo.front().quantity -= rest;
-                            Trade tr{
-                                next_trade_id_++,
-                                fifo.front().id,
-                                order.id,
-                                order.side,
-                                fifo.front().price,
-                                rest,
-                                now_ns()
-                            };
-                            trades.push_back(tr);
-                            rest = 0;
-                            if (fifo.front().quantity == 0) {
-                                index_.erase(fifo.front().id);
-                                fifo.pop_front();
-                            }
-                            break;
-                        }
-                    }
-
-                    if (fifo.empty()) {
-                        it = bids_.erase(it);
-                    } else {
-                        ++it;
-                    }
-
-                    if (rest == 0) {
-                        return trades;
-                    }
-                }
-            }
+    std::vector<Trade> OrderBook::apply(const JournalRecord &rec) {
+        now_ = rec.ts;
+        switch (rec.command) {
+            case Command::Add:
+                return do_add(Order{rec.id, rec.side, rec.price, rec.qty, rec.order_ts, rec.type});
+            case Command::Cancel:
+                do_cancel(rec.id);
+                break;
+            case Command::Modify:
+                do_modify(rec.id,
+                          (rec.flags & JournalRecord::has_price) ? std::optional<price4_t>(rec.price) : std::nullopt,
+                          (rec.flags & JournalRecord::has_qty) ? std::optional<qty_t>(rec.qty) : std::nullopt);
+                break;
+            case Command::Decrease:
+                do_decrease(rec.id, rec.qty);
+                break;
+            case Command::Clear:
+                do_clear();
+                break;
+        }
+        return {};
+    }
 
-            auto [lvlIt, _] = asks_.try_emplace(order.price, PriceLevel{order.price});
-            lvlIt->second.fifo.emplace_back(Order{order.id, Side::Ask, order.price, rest, order.timestamp});
-            const auto &fifo = lvlIt->second.fifo;
-            const std::size_t offset = fifo.size() - 1;
-            index_[order.id] = {order.side, rest, order.price, offset};
+    std::vector<Trade> OrderBook::do_add(const Order &order) {
+        if (store_->contains(order.id)) {
+            return {};
         }
 
-        return trades;
+        return (order.side == Side::Bid)
+                   ? execute(asks_, bids_, order)
+                   : execute(bids_, asks_, order);
+    }
+
+    OrderBook::handle_t OrderBook::find(order_id_t order_id) const {
+        const handle_t h = store_->find(order_id);
+        return (h != OrderStore::npos && (*store_)[h].owner == book_id_) ? h : OrderStore::npos;
     }
 
     template<class Tree>
-    auto OrderBook::level(Tree &tree, price4_t price)
-        -> decltype(tree.find(price)) {
-        return tree.find(price);
+    void OrderBook::rest(Tree &tree, const Order &order, qty_t qty) {
+        const handle_t h = store_->insert(order.id);
+        PriceLevel &lvl = *tree.try_emplace(order.price);
+
+        OrderNode &node = (*store_)[h];
+        node = OrderNode{order.id, order.timestamp, order.price, qty, lvl.tail, OrderStore::npos,
+                         book_id_, order.side};
+
+        if (lvl.tail != OrderStore::npos)
+            (*store_)[lvl.tail].next = h;
+        else
+            lvl.head = h;
+        lvl.tail = h;
+        set_level_qty(lvl, order.side, lvl.total_qty + qty);
+        state_hash_ += order_term(h);
+        ++live_orders_;
+    }
+
+    void OrderBook::unlink(PriceLevel &level, handle_t h) {
+        const OrderNode &node = (*store_)[h];
+
+        // The follower's predecessor changes, so its term is swapped along with ours.
+        state_hash_ -= order_term(h);
+        if (node.next != OrderStore::npos)
+            state_hash_ -= order_term(node.next);
+
+        if (node.prev != OrderStore::npos)
+            (*store_)[node.prev].next = node.next;
+        else
+            level.head = node.next;
+
+        if (node.next != OrderStore::npos)
+            (*store_)[node.next].prev = node.prev;
+        else
+            level.tail = node.prev;
+
+        if (node.next != OrderStore::npos)
+            state_hash_ += order_term(node.next);
+        set_level_qty(level, node.side, level.total_qty - node.quantity);
+    }
+
+    void OrderBook::set_level_qty(PriceLevel &level, Side side, qty_t total) {
+        if (level.total_qty != 0)
+            state_hash_ -= level_term(side, level.price, level.total_qty);
+        level.total_qty = total;
+        if (total != 0)
+            state_hash_ += level_term(side, level.price, total);
+    }
+
+    void OrderBook::release(handle_t h) {
+        store_->erase(h);
+        --live_orders_;
     }
 
     template<class Tree>
-    void OrderBook::erase_from_level(Tree &tree,
-                                     typename Tree::iterator level_it,
-                                     std::size_t pos) {
-        auto &fifo = level_it->second.fifo;
-        fifo.erase(fifo.begin() + static_cast<std::ptrdiff_t>(pos));
+    void OrderBook::remove(Tree &tree, handle_t h) {
+        auto levelIt = tree.find((*store_)[h].price);
+        unlink(*levelIt, h);
+        if (levelIt->head == OrderStore::npos)
+            tree.erase(levelIt);
+        release(h);
+    }
 
-        for (std::size_t i = pos; i < fifo.size(); ++i)
-            index_[fifo[i].id].index_in_level = i;
+    template<class Tree>
+    bool OrderBook::crosses(const Tree &tree, price4_t limit, price4_t price) {
+        // asks_ (less): stop once price > limit; bids_ (greater): stop once price < limit.
+        return !tree.key_comp()(limit, price);
+    }
 
-        if (fifo.empty())
-            tree.erase(level_it);
+    template<class Tree>
+    std::uint64_t OrderBook::available_qty(const Tree &tree, price4_t limit, qty_t wanted) const {
+        std::uint64_t total = 0;
+        for (auto it = tree.cbegin(); it != tree.cend() && crosses(tree, limit, it->price); ++it) {
+            total += it->total_qty;
+            if (total >= wanted)
+                return total;
+        }
+        return total;
     }
 
-    bool OrderBook::cancel_order(std::uint64_t order_id) {
-        auto idx = index_.find(order_id);
-        if (idx == index_.end()) {
-            return false;
+    template<class Tree>
+    qty_t OrderBook::match(Tree &tree, const Order &order, price4_t limit, std::vector<Trade> &trades) {
+        qty_t rest = order.quantity;
+
+        for (auto it = tree.begin(); it != tree.end() && rest > 0 && crosses(tree, limit, it->price);) {
+            PriceLevel &lvl = *it;
+
+            while (lvl.head != OrderStore::npos && rest > 0) {
+                const handle_t h = lvl.head;
+                OrderNode &maker = (*store_)[h];
+                const qty_t fill = std::min(maker.quantity, rest);
+
+                trades.push_back(Trade{
+                    next_trade_id_++,
+                    maker.id,
+                    order.id,
+                    order.side,
+                    maker.price,
+                    fill,
+                    engine_time()
+                });
+
+                rest -= fill;
+                if (fill == maker.quantity) {
+                    unlink(lvl, h);
+                    release(h);
+                } else {
+                    state_hash_ -= order_term(h);
+                    maker.quantity -= fill;
+                    state_hash_ += order_term(h);
+                    set_level_qty(lvl, maker.side, lvl.total_qty - fill);
+                }
+            }
+
+            if (lvl.head == OrderStore::npos) {
+                it = tree.erase(it);
+            } else {
+                ++it;
+            }
         }
 
-        const Side side = idx->second.side;
-        const price4_t price_key = idx->second.price;
-        std::size_t pos = idx->second.index_in_level;
+        return rest;
+    }
 
-        if (side == Side::Bid) {
-            erase_from_level(bids_, level(bids_, price_key), pos);
-        } else {
-            erase_from_level(asks_, level(asks_, price_key), pos);
+    template<class Opposite, class Same>
+    std::vector<Trade> OrderBook::execute(Opposite &opposite, Same &same, const Order &order) {
+        std::vector<Trade> trades;
+
+        // Market orders sweep the whole opposite side.
+        const price4_t limit = (order.type != OrderType::Market)
+                                   ? order.price
+                                   : (order.side == Side::Bid)
+                                         ? std::numeric_limits<price4_t>::max()
+                                         : std::numeric_limits<price4_t>::min();
+
+        // FOK is decided before any mutation so a rejected order leaves no trace.
+        if (order.type == OrderType::FOK && available_qty(opposite, limit, order.quantity) < order.quantity) {
+            return trades;
         }
 
-        index_.erase(idx);
-        return true;
+        const qty_t rest_qty = match(opposite, order, limit, trades);
+        if (rest_qty == 0 || order.type != OrderType::Limit) {
+            return trades;
+        }
+
+        rest(same, order, rest_qty);
+        return trades;
     }
 
-    bool OrderBook::modify_order(std::uint64_t order_id,
-                                 std::optional<price4_t> new_price,
-                                 std::optional<qty_t> new_qty) {
-        auto idx = index_.find(order_id);
-        if (idx == index_.end())
+    bool OrderBook::do_cancel(order_id_t order_id) {
+        const handle_t h = find(order_id);
+        if (h == OrderStore::npos) {
             return false;
+        }
 
-        const Side side = idx->second.side;
-        const price4_t price_key = idx->second.price;
-        std::size_t pos = idx->second.index_in_level;
+        if ((*store_)[h].side == Side::Bid) {
+            remove(bids_, h);
+        } else {
+            remove(asks_, h);
+        }
+        return true;
+    }
 
-        auto modify_impl = [&](auto &tree) -> bool {
-            auto levelIt = level(tree, price_key);
-            if (levelIt == tree.end())
-                return false;
+    bool OrderBook::do_modify(order_id_t order_id,
+                              std::optional<price4_t> new_price,
+                              std::optional<qty_t> new_qty) {
+        const handle_t h = find(order_id);
+        if (h == OrderStore::npos)
+            return false;
 
-            auto &fifo = levelIt->second.fifo;
-            Order &ord = fifo[pos];
+        OrderNode &node = (*store_)[h];
 
-            price4_t px = new_price ? *new_price : ord.price;
-            qty_t qty = new_qty ? *new_qty : ord.quantity;
+        auto modify_impl = [&](auto &tree) -> bool {
+            price4_t px = new_price ? *new_price : node.price;
+            qty_t qty = new_qty ? *new_qty : node.quantity;
 
             if (qty == 0)
-                return cancel_order(order_id);
-
-            if (px == ord.price) {
-                ord.quantity = qty;
-                idx->second.quantity = qty;
+                return do_cancel(order_id);
+
+            if (px == node.price) {
+                PriceLevel &lvl = *tree.find(px);
+                set_level_qty(lvl, node.side, lvl.total_qty - node.quantity + qty);
+                state_hash_ -= order_term(h);
+                node.quantity = qty;
+                state_hash_ += order_term(h);
                 return true;
             }
 
-            Order moved = ord;
-            erase_from_level(tree, levelIt, pos);
-            index_.erase(idx);
-
-            moved.price = px;
-            moved.quantity = qty;
-            moved.timestamp = now_ns();
+            Order moved{node.id, node.side, px, qty, engine_time()};
+            remove(tree, h);
 
-            add_order(moved);
+            do_add(moved);
             return true;
         };
 
         // dispatch to the correct tree (no type clash)
-        return (side == Side::Bid)
+        return (node.side == Side::Bid)
                    ? modify_impl(bids_)
                    : modify_impl(asks_);
     }
 
-    bool OrderBook::decrease_qty(order_id_t order_id, qty_t delta) {
-        auto idx = index_.find(order_id);
-        if (idx == index_.end())
+    bool OrderBook::do_decrease(order_id_t order_id, qty_t delta) {
+        const handle_t h = find(order_id);
+        if (h == OrderStore::npos)
             return false;
 
-        return modify_order(order_id, idx->second.price, idx->second.quantity - delta);
+        const OrderNode &node = (*store_)[h];
+        return do_modify(order_id, node.price, node.quantity - delta);
     }
 
     std::optional<Side> OrderBook::side_of(order_id_t order_id) const {
-        auto idx = index_.find(order_id);
-        if (idx == index_.end())
+        const handle_t h = find(order_id);
+        if (h == OrderStore::npos)
             return std::nullopt;
 
-        return idx->second.side;
+        return (*store_)[h].side;
     }
 
+    std::optional<Order> OrderBook::top(const PriceLevel &level) const {
+        const OrderNode &node = (*store_)[level.head];
+        return Order{node.id, node.side, node.price, node.quantity, node.timestamp};
+    }
 
     std::optional<Order> OrderBook::best_bid() const {
         if (bids_.empty())
             return std::nullopt;
 
-        const auto &level = bids_.begin()->second;
-        return level.fifo.front();
+        return top(*bids_.begin());
     }
 
     std::optional<Order> OrderBook::best_ask() const {
         if (asks_.empty())
             return std::nullopt;
 
-        const auto &level = asks_.begin()->second;
-        return level.fifo.front();
+        return top(*asks_.begin());
     }
 
     std::vector<std::pair<price4_t, qty_t>> OrderBook::depth(Side side, std::size_t levels) const {
@@ -272,14 +420,7 @@ namespace trading {
             if (levels == 0) return orders;
 
             for (auto it = tree.cbegin(); it != tree.cend() && levels--; ++it) {
-                const price4_t price = it->first;
-                const auto &fifo = it->second.fifo;
-                int total_qty = std::accumulate(
-                    fifo.begin(), fifo.end(), 0,
-                    [](qty_t acc, const Order &order) {
-                        return acc + order.quantity;
-                    });
-                orders.insert(orders.end(), std::make_pair(price, total_qty));
+                orders.insert(orders.end(), std::make_pair(it->price, it->total_qty));
             }
             return orders;
         };
@@ -290,14 +431,43 @@ namespace trading {
     }
 
     std::size_t OrderBook::total_orders() const {
-        return index_.size();
+        return live_orders_;
     }
 
     void OrderBook::clear() {
-        bids_.clear();
-        asks_.clear();
-        index_.clear();
+        now_ = 0;
+        if (journal_) {
+            JournalRecord rec{};
+            rec.command = Command::Clear;
+            record(rec);
+        }
+        do_clear();
+    }
+
+    void OrderBook::do_clear() {
+        auto release_all = [this](auto &tree) {
+            for (const PriceLevel &lvl: tree) {
+                for (handle_t h = lvl.head; h != OrderStore::npos;) {
+                    const handle_t next = (*store_)[h].next;
+                    release(h);
+                    h = next;
+                }
+            }
+            tree.clear();
+        };
+
+        release_all(bids_);
+        release_all(asks_);
         next_trade_id_ = 1;
-        // index_.rehash(0);
+        state_hash_ = 0;
+        unjournaled_ = false;
+    }
+
+    MemoryUsage OrderBook::memory_usage() const {
+        MemoryUsage m;
+        m.levels = sizeof(OrderBook) + (bids_.capacity() + asks_.capacity()) * sizeof(PriceLevel);
+        m.orders = live_orders_ * sizeof(OrderNode);
+        m.index  = live_orders_ * OrderStore::index_entry_bytes;
+        return m;
     }
 } // namespace trading
@@ -1,26 +1,23 @@
 #pragma once
 
+#include <algorithm>
 #include <cstdint>
-#include <deque>
+#include <functional>
 #include <iomanip>
 #include <iostream>
-#include <map>
-#include <unordered_map>
+#include <memory>
 #include <vector>
 #include <optional>
 
+#include "order_store.h"
+#include "types.h"
+
 namespace trading {
 
-// ---- ITCH-aligned scalar types -------------------------------------------
-using order_id_t = std::uint64_t;   // ITCH order_reference_number
-using qty_t      = std::uint32_t;   // ITCH shares
-using price4_t   = std::uint32_t;   // ITCH price (USD * 10^4)
-using ts_ns_t    = std::uint64_t;   // ITCH timestamp (ns since midnight; widened from 48-bit)
+class Journal;
+struct JournalRecord;
 
 // --- Basic types -----------------------------------------------------------------------------
-/// Bid = buy, Ask = sell.
-enum class Side { Bid, Ask };
-
 /// Client order submitted to the book.
 struct Order {
     std::uint64_t id;          ///< Unique client-supplied id
@@ -28,6 +25,7 @@ struct Order {
     price4_t      price;       ///< Limit price (floating-point for simplicity) [NOTE: ITCH fixed-point int: USD * 1e4]
     qty_t         quantity;    ///< Remaining quantity (shares/lots)
     ts_ns_t       timestamp;   ///< Epoch microseconds — used for price-time priority [NOTE: ITCH provides ns since midnight]
+    OrderType     type = OrderType::Limit; ///< Execution style; only Limit residuals rest
 };
 
 /// Execution report produced by the matching engine.
@@ -44,11 +42,22 @@ struct Trade {
 // --- OrderBook interface ----------------------------------------------------------------------
 class OrderBook {
 public:
-    OrderBook() = default;
+    /// Stand-alone book with its own private order store.
+    OrderBook();
+
+    /// Book drawing orders from a store shared with other books (full-universe mode).
+    /// `store` must outlive the book.
+    explicit OrderBook(OrderStore& store);
 
-    /// Submit a limit order. Returns all trades generated while executing the order.
-    /// If the order is fully filled, it does not enter the book; else the residual size becomes
-    /// a new resting order.
+    OrderBook(OrderBook&&) = default;
+    OrderBook& operator=(OrderBook&&) = delete;
+    ~OrderBook();
+
+    /// Submit an order. Returns all trades generated while executing the order.
+    /// Limit: if the order is fully filled, it does not enter the book; else the residual size
+    /// becomes a new resting order. Market/IOC: the residual is discarded. FOK: the opposite side
+    /// is checked for enough liquidity first; if it falls short nothing is touched and no trades
+    /// are returned.
     std::vector<Trade> add_order(const Order& order);
 
     /// Cancel a resting order by id. Returns true if the order was found and removed.
@@ -71,38 +80,158 @@ public:
     std::vector<std::pair<price4_t, qty_t>> depth(Side side, std::size_t levels = 10) const;
 
     std::size_t total_orders() const;                    ///< #active resting orders
-    void clear();                                        ///< Remove all orders
+    void clear();                                        ///< Remove all orders, restart trade ids
+
+    /// Order-independent hash of the resting state: every level (side, price, total qty) and
+    /// every order (side, price, id, qty, id of the order ahead of it in the level). Maintained in
+    /// O(1) per mutation and a function of the current book only, so two engines whose books hold
+    /// the same orders in the same FIFO order hash equal, however they got there.
+    std::uint64_t state_hash() const { return state_hash_; }
+
+    // --- Durability --------------------------------------------------------------------------
+    /// Append every inbound add/cancel/modify/decrease and `clear()` to `journal` before applying
+    /// it (nullptr detaches). If the journal has failed, the mutator throws std::system_error and
+    /// the command is not applied. `journal` must outlive the attachment.
+    /// Replaying the journal into an empty book must rebuild this one, so the book must be fresh
+    /// (no resting orders, no trades) or built only by `apply`, i.e. recovered from the journal
+    /// being attached; otherwise std::logic_error.
+    void attach_journal(Journal* journal);
+
+    /// Apply a journaled command at its recorded engine time without journaling it again.
+    /// Used by `Journal::replay`; returns the trades the command generated.
+    std::vector<Trade> apply(const JournalRecord& record);
+
+    /// Bytes attributable to this book: its ladders plus its share of pool nodes and index
+    /// entries. Unused pool capacity is reported by `OrderStore::memory_usage`.
+    MemoryUsage memory_usage() const;
 
 private:
-    // Price bucket holding FIFO queue of resting orders.
+    using handle_t = OrderStore::handle_t;
+
+    // Price bucket: FIFO of resting orders linked through the store, oldest at `head`.
     struct PriceLevel {
-        price4_t      price;
-        std::deque<Order> fifo;   ///< Resting orders, oldest first
+        price4_t price;
+        qty_t    total_qty;       ///< Sum of resting quantity, kept for O(1) depth
+        handle_t head;
+        handle_t tail;
+    };
+
+    // One side of the book as a sorted vector, worst price first so the touch sits at the back
+    // and trading/quoting at the inside is a push/pop. `Better(a, b)` is true if price `a` has
+    // priority over `b`; iteration is best-first.
+    template<class Better>
+    class Ladder {
+    public:
+        using iterator       = typename std::vector<PriceLevel>::reverse_iterator;
+        using const_iterator = typename std::vector<PriceLevel>::const_reverse_iterator;
+
+        iterator       begin()        { return levels_.rbegin(); }
+        iterator       end()          { return levels_.rend(); }
+        const_iterator begin()  const { return levels_.crbegin(); }
+        const_iterator end()    const { return levels_.crend(); }
+        const_iterator cbegin() const { return levels_.crbegin(); }
+        const_iterator cend()   const { return levels_.crend(); }
+
+        bool        empty()    const { return levels_.empty(); }
+        std::size_t capacity() const { return levels_.capacity(); }
+        Better      key_comp() const { return {}; }
+
+        iterator find(price4_t price) {
+            auto it = lower(price);
+            return (it != levels_.end() && it->price == price) ? iterator(it + 1) : end();
+        }
+
+        // Existing level at `price`, or a new empty one inserted in order.
+        iterator try_emplace(price4_t price) {
+            auto it = lower(price);
+            if (it == levels_.end() || it->price != price)
+                it = levels_.insert(it, PriceLevel{price, 0, OrderStore::npos, OrderStore::npos});
+            return iterator(it + 1);
+        }
+
+        // Returns the next level in best-first order.
+        iterator erase(iterator it) { return iterator(levels_.erase(std::prev(it.base()))); }
+
+        void clear() { levels_.clear(); }
+
+    private:
+        // First level whose price is not worse than `price`.
+        typename std::vector<PriceLevel>::iterator lower(price4_t price) {
+            return std::lower_bound(levels_.begin(), levels_.end(), price,
+                                    [](const PriceLevel& lvl, price4_t px) { return Better{}(px, lvl.price); });
+        }
+
+        std::vector<PriceLevel> levels_;
     };
 
+    // Command bodies shared by the public entry points and `apply`; they use `engine_time()`.
+    std::vector<Trade> do_add(const Order& order);
+    bool do_cancel(order_id_t order_id);
+    bool do_modify(order_id_t order_id, std::optional<price4_t> new_price, std::optional<qty_t> new_qty);
+    bool do_decrease(order_id_t order_id, qty_t delta);
+    void do_clear();
+
+    // Stamp the command with the clock and append it to the attached journal.
+    void record(JournalRecord rec);
+
+    // Time of the command being applied: the journaled/replayed stamp, else the clock on first use.
+    ts_ns_t engine_time();
+
+    // Index lookup restricted to orders resting in this book.
+    handle_t find(order_id_t order_id) const;
+
+    // Allocate a node for `order` with `qty` and append it to its level in `tree`.
+    template<class Tree>
+    void rest(Tree& tree, const Order& order, qty_t qty);
+
+    // Unlink `h` from its level in `tree`, dropping the level if it empties, and free the node.
+    template<class Tree>
+    void remove(Tree& tree, handle_t h);
+
+    void unlink(PriceLevel& level, handle_t h);
+    void release(handle_t h);
+
+    // Term of resting order `h` in `state_hash_`; depends on its level predecessor.
+    std::uint64_t order_term(handle_t h) const;
+
+    // Set a level's total, swapping its term in `state_hash_` (empty levels contribute nothing).
+    void set_level_qty(PriceLevel& level, Side side, qty_t total);
+
+    // True if a level at `price` in `tree` is marketable for a taker limited by `limit`.
     template<class Tree>
-    auto level(Tree& tree, price4_t price) -> decltype(tree.find(price));
+    static bool crosses(const Tree& tree, price4_t limit, price4_t price);
 
+    // Quantity resting in `tree` at prices crossing `limit`; stops counting once `wanted` is reached.
     template<class Tree>
-    void erase_from_level(Tree& tree,
-                          typename Tree::iterator level_it,
-                          std::size_t pos);
+    std::uint64_t available_qty(const Tree& tree, price4_t limit, qty_t wanted) const;
+
+    // Match `order` against the opposite `tree` up to `limit`. Returns the unfilled quantity.
+    template<class Tree>
+    qty_t match(Tree& tree, const Order& order, price4_t limit, std::vector<Trade>& trades);
+
+    // Full add path: FOK pre-check, match against `opposite`, rest Limit residual in `same`.
+    template<class Opposite, class Same>
+    std::vector<Trade> execute(Opposite& opposite, Same& same, const Order& order);
+
+    std::optional<Order> top(const PriceLevel& level) const;
+
+    std::unique_ptr<OrderStore> own_store_;   ///< Set only for stand-alone books
+    OrderStore*                 store_;
+    std::uint16_t               book_id_;
 
     // bids sorted highest-price-first; asks lowest-price-first.
-    std::map<price4_t, PriceLevel, std::greater<price4_t>> bids_;
-    std::map<price4_t, PriceLevel, std::less<price4_t>>    asks_;
+    Ladder<std::greater<price4_t>> bids_;
+    Ladder<std::less<price4_t>>    asks_;
 
-    // Fast lookup from order id → location for cancel/modify.
-    struct OrderRef {
-        Side     side;
-        qty_t quantity;
-        price4_t price;
-        std::size_t index_in_level;
-    };
-    std::unordered_map<std::uint64_t, OrderRef> index_;
+    std::size_t   live_orders_ = 0;
+    std::uint64_t state_hash_  = 0;   ///< Sum of level and order terms, see `state_hash()`
+    bool          unjournaled_ = false;   ///< A command ran with no journal attached since `clear()`
 
     // Simple monotonically increasing trade id generator.
     std::uint64_t next_trade_id_ = 1;
+
+    Journal* journal_ = nullptr;
+    ts_ns_t  now_     = 0;   ///< Engine time of the current command; 0 = not read yet
 };
 
 inline void print_order_book(const OrderBook& book, std::size_t levels = 10) {
@@ -132,4 +261,13 @@ inline void print_order_book(const OrderBook& book, std::size_t levels = 10) {
         std::cout << "-------------------------------\n";
     }
 
+inline void print_memory_usage(const MemoryUsage& m) {
+        auto kib = [](std::size_t bytes) { return std::to_string(bytes / 1024) + " KiB"; };
+
+        std::cout << "memory: levels " << kib(m.levels)
+                  << ", orders " << kib(m.orders)
+                  << ", index " << kib(m.index)
+                  << ", total " << kib(m.total()) << "\n";
+    }
+
 } // namespace trading
@@ -0,0 +1,138 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "types.h"
+
+namespace trading {
+
+/// Byte breakdown reported by `OrderStore::memory_usage` / `OrderBook::memory_usage`.
+struct MemoryUsage {
+    std::size_t levels = 0;   ///< Price ladders + book object itself
+    std::size_t orders = 0;   ///< Order pool nodes
+    std::size_t index  = 0;   ///< Order id → node index (estimate, excludes allocator overhead)
+
+    std::size_t total() const { return levels + orders + index; }
+
+    MemoryUsage& operator+=(const MemoryUsage& o) {
+        levels += o.levels;
+        orders += o.orders;
+        index  += o.index;
+        return *this;
+    }
+};
+
+/// Resting order as stored in the pool. Orders of one price level form a doubly linked FIFO
+/// through `prev`/`next`; free nodes are chained through `next`.
+struct OrderNode {
+    order_id_t    id;
+    ts_ns_t       timestamp;
+    price4_t      price;
+    qty_t         quantity;
+    std::uint32_t prev;
+    std::uint32_t next;
+    std::uint16_t owner;      ///< Id of the book the order rests in (one per ITCH stock locate)
+    Side          side;
+};
+static_assert(sizeof(OrderNode) == 40, "keep pool nodes compact");
+
+/// `owner` is 16-bit, one id per ITCH stock locate, which caps the books one store can serve;
+/// `OrderStore::register_book` refuses to hand out more rather than let ids wrap and alias.
+inline constexpr std::size_t max_books_per_store =
+    std::size_t{std::numeric_limits<decltype(OrderNode::owner)>::max()} + 1;
+
+// --- OrderStore ------------------------------------------------------------------------------
+/// Order pool and order id index shared by any number of books. ITCH order reference numbers
+/// are unique across the whole feed, so one index serves the entire universe and each book only
+/// keeps its (small) price ladders.
+class OrderStore {
+public:
+    using handle_t = std::uint32_t;
+    static constexpr handle_t npos = std::numeric_limits<handle_t>::max();
+
+    /// Pool grows in fixed chunks: no reallocation/copy spikes and stable node addresses.
+    static constexpr std::size_t chunk_shift = 12;
+    static constexpr std::size_t chunk_size  = std::size_t{1} << chunk_shift;
+
+    /// `expected_orders` pre-sizes the pool and index for the peak number of resting orders.
+    explicit OrderStore(std::size_t expected_orders = 0) {
+        chunks_.reserve((expected_orders + chunk_size - 1) / chunk_size);
+        index_.reserve(expected_orders);
+    }
+
+    OrderStore(const OrderStore&) = delete;
+    OrderStore& operator=(const OrderStore&) = delete;
+
+    /// Hand out a distinct owner id to every book attached to this store.
+    /// Throws std::length_error past `max_books_per_store` books.
+    std::uint16_t register_book() {
+        if (next_book_id_ == max_books_per_store)
+            throw std::length_error("OrderStore: too many books for 16-bit owner ids");
+        return static_cast<std::uint16_t>(next_book_id_++);
+    }
+
+    OrderNode&       operator[](handle_t h)       { return chunks_[h >> chunk_shift][h & (chunk_size - 1)]; }
+    const OrderNode& operator[](handle_t h) const { return chunks_[h >> chunk_shift][h & (chunk_size - 1)]; }
+
+    /// Allocate a node for `id` and register it in the index.
+    handle_t insert(order_id_t id) {
+        handle_t h = free_head_;
+        if (h != npos) {
+            free_head_ = (*this)[h].next;
+        } else {
+            if (high_water_ == chunks_.size() * chunk_size)
+                chunks_.push_back(std::make_unique<OrderNode[]>(chunk_size));
+            h = static_cast<handle_t>(high_water_++);
+        }
+        index_.emplace(id, h);
+        ++live_;
+        return h;
+    }
+
+    /// Drop `h` from the index and return it to the free list.
+    void erase(handle_t h) {
+        OrderNode& node = (*this)[h];
+        index_.erase(node.id);
+        node.next = free_head_;
+        free_head_ = h;
+        --live_;
+    }
+
+    handle_t find(order_id_t id) const {
+        auto it = index_.find(id);
+        return it == index_.end() ? npos : it->second;
+    }
+
+    bool contains(order_id_t id) const { return index_.contains(id); }
+
+    std::size_t size() const { return live_; }   ///< #live orders across all books
+
+    /// Approximate bytes of one index entry (libstdc++-style node: next pointer + value).
+    static constexpr std::size_t index_entry_bytes =
+        sizeof(void*) + sizeof(std::pair<const order_id_t, handle_t>);
+
+    /// Bytes held by the pool and index, including unused pool capacity.
+    MemoryUsage memory_usage() const {
+        MemoryUsage m;
+        m.orders = chunks_.size() * chunk_size * sizeof(OrderNode)
+                 + chunks_.capacity() * sizeof(std::unique_ptr<OrderNode[]>);
+        m.index  = index_.bucket_count() * sizeof(void*) + index_.size() * index_entry_bytes;
+        return m;
+    }
+
+private:
+    std::vector<std::unique_ptr<OrderNode[]>> chunks_;
+    std::unordered_map<order_id_t, handle_t>  index_;
+    std::size_t   high_water_   = 0;      ///< Nodes ever handed out (free list covers the rest)
+    std::size_t   live_         = 0;
+    handle_t      free_head_    = npos;
+    std::size_t   next_book_id_ = 0;
+};
+
+} // namespace trading
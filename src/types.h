@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstdint>
+
+namespace trading {
+
+// ---- ITCH-aligned scalar types -------------------------------------------
+using order_id_t = std::uint64_t;   // ITCH order_reference_number
+using qty_t      = std::uint32_t;   // ITCH shares
+using price4_t   = std::uint32_t;   // ITCH price (USD * 10^4)
+using ts_ns_t    = std::uint64_t;   // ITCH timestamp (ns since midnight; widened from 48-bit)
+
+/// Bid = buy, Ask = sell.
+enum class Side : std::uint8_t { Bid, Ask };
+
+/// Time-in-force / execution style of an incoming order.
+/// Limit  – match up to `price`, residual rests in the book.
+/// Market – match at any price, residual is dropped (never rests).
+/// IOC    – match up to `price`, residual is dropped (immediate-or-cancel).
+/// FOK    – fill the whole quantity up to `price` or do nothing (fill-or-kill).
+enum class OrderType : std::uint8_t { Limit, Market, IOC, FOK };
+
+} // namespace trading
@@ -1,10 +1,22 @@
 #define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
 #include <doctest/doctest.h>
+#include <chrono>
+#include <csignal>
+#include <filesystem>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+#include <sys/resource.h>
+#include "../src/journal.h"
 #include "../src/order_book.h"
 
 using trading::Side;
 using trading::OrderBook;
 using trading::Order;
+using trading::OrderType;
+using trading::OrderStore;
+using trading::Journal;
+using trading::Trade;
 
 
 static std::uint64_t ts = 0;
@@ -13,6 +25,10 @@ auto make = [](std::uint64_t id, Side s, double px, std::uint32_t qty) {
     return Order{id, s, px, qty, ts++};
 };
 
+auto make_typed = [](std::uint64_t id, Side s, std::uint32_t px, std::uint32_t qty, OrderType type) {
+    return Order{id, s, px, qty, ts++, type};
+};
+
 
 TEST_CASE("single cross – full fill") {
     OrderBook book;
@@ -105,3 +121,413 @@ TEST_CASE("clear resets book state") {
     CHECK(book.best_ask() == std::nullopt);
     CHECK(book.add_order(make(1, Side::Bid, 80.0, 5)).size() == 0); // id reused ok
 }
+
+
+TEST_CASE("IOC – partial fill, residual is dropped") {
+    OrderBook book;
+    book.add_order(make_typed(1, Side::Ask, 100, 30, OrderType::Limit));
+    book.add_order(make_typed(2, Side::Ask, 102, 30, OrderType::Limit));   // beyond IOC limit
+
+    auto trades = book.add_order(make_typed(3, Side::Bid, 101, 50, OrderType::IOC));
+
+    REQUIRE(trades.size() == 1);
+    CHECK(trades[0].quantity == 30);
+    CHECK(book.best_bid() == std::nullopt);          // residual 20 did not rest
+    CHECK(book.best_ask()->id == 2);
+    CHECK(book.total_orders() == 1);
+}
+
+TEST_CASE("IOC – no cross leaves book untouched") {
+    OrderBook book;
+    book.add_order(make_typed(1, Side::Bid, 100, 10, OrderType::Limit));
+    CHECK(book.add_order(make_typed(2, Side::Ask, 101, 10, OrderType::IOC)).empty());
+    CHECK(book.best_ask() == std::nullopt);
+    CHECK(book.total_orders() == 1);
+}
+
+TEST_CASE("FOK – fills across levels when liquidity suffices") {
+    OrderBook book;
+    book.add_order(make_typed(1, Side::Bid, 100, 20, OrderType::Limit));
+    book.add_order(make_typed(2, Side::Bid,  99, 20, OrderType::Limit));
+
+    auto trades = book.add_order(make_typed(3, Side::Ask, 99, 30, OrderType::FOK));
+
+    REQUIRE(trades.size() == 2);
+    CHECK(trades[0].price == 100);
+    CHECK(trades[1].quantity == 10);
+    CHECK(book.best_bid()->quantity == 10);
+    CHECK(book.best_ask() == std::nullopt);
+}
+
+TEST_CASE("FOK – insufficient liquidity is rejected without touching the book") {
+    OrderBook book;
+    book.add_order(make_typed(1, Side::Ask, 100, 20, OrderType::Limit));
+    book.add_order(make_typed(2, Side::Ask, 105, 50, OrderType::Limit));   // beyond FOK limit
+
+    CHECK(book.add_order(make_typed(3, Side::Bid, 101, 30, OrderType::FOK)).empty());
+    CHECK(book.best_ask()->quantity == 20);
+    CHECK(book.total_orders() == 2);
+
+    // Trade ids were not consumed by the rejected order.
+    auto trades = book.add_order(make_typed(4, Side::Bid, 100, 20, OrderType::Limit));
+    REQUIRE(trades.size() == 1);
+    CHECK(trades[0].id == 1);
+}
+
+TEST_CASE("market order sweeps all levels and never rests") {
+    OrderBook book;
+    book.add_order(make_typed(1, Side::Ask, 100, 10, OrderType::Limit));
+    book.add_order(make_typed(2, Side::Ask, 500, 10, OrderType::Limit));
+
+    auto trades = book.add_order(make_typed(3, Side::Bid, 0, 25, OrderType::Market));
+
+    REQUIRE(trades.size() == 2);
+    CHECK(trades[1].price == 500);
+    CHECK(book.best_ask() == std::nullopt);
+    CHECK(book.best_bid() == std::nullopt);          // unfilled 5 discarded
+    CHECK(book.total_orders() == 0);
+}
+
+TEST_CASE("shared store – books are isolated but share one id space") {
+    OrderStore store;
+    OrderBook aapl(store);
+    OrderBook amzn(store);
+
+    aapl.add_order(make_typed(1, Side::Bid, 100, 10, OrderType::Limit));
+    amzn.add_order(make_typed(2, Side::Ask, 100, 10, OrderType::Limit));   // no cross between books
+
+    CHECK(aapl.total_orders() == 1);
+    CHECK(amzn.total_orders() == 1);
+    CHECK(store.size() == 2);
+
+    CHECK(amzn.cancel_order(1) == false);            // id lives in the other book
+    CHECK(amzn.side_of(1) == std::nullopt);
+    CHECK(amzn.add_order(make_typed(1, Side::Bid, 90, 5, OrderType::Limit)).empty());
+    CHECK(amzn.total_orders() == 1);                 // duplicate id rejected store-wide
+
+    aapl.clear();
+    CHECK(store.size() == 1);
+    CHECK(amzn.best_ask()->id == 2);
+}
+
+TEST_CASE("shared store – owner ids never wrap") {
+    OrderStore store;
+    for (std::size_t i = 0; i < trading::max_books_per_store; ++i)
+        store.register_book();
+
+    CHECK_THROWS_AS(OrderBook{store}, std::length_error);
+}
+
+TEST_CASE("cancel in the middle of a level keeps FIFO intact") {
+    OrderBook book;
+    book.add_order(make_typed(1, Side::Ask, 100, 10, OrderType::Limit));
+    book.add_order(make_typed(2, Side::Ask, 100, 20, OrderType::Limit));
+    book.add_order(make_typed(3, Side::Ask, 100, 30, OrderType::Limit));
+
+    book.add_order(make_typed(4, Side::Bid, 100, 5, OrderType::Limit));   // partial on id 1
+    REQUIRE(book.cancel_order(2));
+    CHECK(book.depth(Side::Ask, 1).front().second == 35);
+
+    auto trades = book.add_order(make_typed(5, Side::Bid, 100, 10, OrderType::Limit));
+    REQUIRE(trades.size() == 2);
+    CHECK(trades[0].maker_order_id == 1);
+    CHECK(trades[1].maker_order_id == 3);
+}
+
+TEST_CASE("memory_usage tracks resting orders") {
+    OrderStore store;
+    OrderBook book(store);
+    const auto empty = book.memory_usage();
+
+    for (std::uint64_t id = 1; id <= 100; ++id)
+        book.add_order(make_typed(id, Side::Bid, 100 + id % 10, 1, OrderType::Limit));
+
+    const auto used = book.memory_usage();
+    CHECK(used.orders == 100 * sizeof(trading::OrderNode));
+    CHECK(used.index > empty.index);
+    CHECK(used.levels > empty.levels);
+    CHECK(store.memory_usage().orders >= used.orders);
+}
+
+static bool same_trades(const std::vector<Trade>& a, const std::vector<Trade>& b) {
+    if (a.size() != b.size()) return false;
+    for (std::size_t i = 0; i < a.size(); ++i) {
+        if (a[i].id != b[i].id || a[i].maker_order_id != b[i].maker_order_id ||
+            a[i].taker_order_id != b[i].taker_order_id || a[i].price != b[i].price ||
+            a[i].quantity != b[i].quantity || a[i].timestamp != b[i].timestamp)
+            return false;
+    }
+    return true;
+}
+
+TEST_CASE("journal replay rebuilds identical book and trade sequence") {
+    const auto path = (std::filesystem::temp_directory_path() / "order_book_journal_test.bin").string();
+    std::filesystem::remove(path);
+
+    OrderBook live;
+    std::vector<Trade> live_trades;
+    {
+        Journal journal(path, Journal::Options{.batch_records = 3});
+        live.attach_journal(&journal);
+
+        auto add = [&](const Order& o) {
+            auto t = live.add_order(o);
+            live_trades.insert(live_trades.end(), t.begin(), t.end());
+        };
+        add(make_typed(1, Side::Ask, 100, 30, OrderType::Limit));
+        add(make_typed(2, Side::Ask, 101, 30, OrderType::Limit));
+        add(make_typed(3, Side::Bid,  99, 10, OrderType::Limit));
+        add(make_typed(4, Side::Bid, 100, 20, OrderType::IOC));
+        live.decrease_qty(2, 5);
+        live.modify_order(3, std::nullopt, 40);
+        live.cancel_order(1);
+        add(make_typed(5, Side::Bid, 101, 10, OrderType::FOK));
+        add(make_typed(6, Side::Bid, 101, 99, OrderType::FOK));        // rejected, still journaled
+
+        CHECK(journal.appended() == 9);
+        live.attach_journal(nullptr);
+    }   // destructor commits the partial last batch
+
+    OrderBook replayed;
+    std::vector<Trade> replayed_trades;
+    CHECK(Journal::replay(path, replayed, &replayed_trades) == 9);
+
+    CHECK(same_trades(live_trades, replayed_trades));
+    CHECK(replayed.total_orders() == live.total_orders());
+    CHECK(replayed.depth(Side::Bid) == live.depth(Side::Bid));
+    CHECK(replayed.depth(Side::Ask) == live.depth(Side::Ask));
+    CHECK(replayed.state_hash() == live.state_hash());
+
+    // Trade ids carry on from where the original run stopped.
+    auto next_live = live.add_order(make_typed(7, Side::Bid, 101, 1, OrderType::Limit));
+    auto next_replayed = replayed.add_order(make_typed(7, Side::Bid, 101, 1, OrderType::Limit));
+    REQUIRE(next_live.size() == 1);
+    REQUIRE(next_replayed.size() == 1);
+    CHECK(next_live[0].id == next_replayed[0].id);
+
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("journaled clear replays to the same book and trade ids") {
+    const auto path = (std::filesystem::temp_directory_path() / "order_book_journal_clear.bin").string();
+    std::filesystem::remove(path);
+
+    OrderBook live;
+    std::vector<Trade> live_trades;
+    {
+        Journal journal(path);
+        live.attach_journal(&journal);
+        live.add_order(make_typed(1, Side::Ask, 100, 10, OrderType::Limit));
+        live.add_order(make_typed(2, Side::Bid, 100, 5, OrderType::Limit));    // trade id 1
+        live.clear();                                                          // trade ids restart
+        live.add_order(make_typed(3, Side::Ask, 101, 10, OrderType::Limit));
+        live_trades = live.add_order(make_typed(4, Side::Bid, 101, 4, OrderType::Limit));
+        live.attach_journal(nullptr);
+    }
+
+    OrderBook replayed;
+    std::vector<Trade> replayed_trades;
+    CHECK(Journal::replay(path, replayed, &replayed_trades) == 5);
+
+    REQUIRE(replayed_trades.size() == 2);
+    CHECK(same_trades(live_trades, {replayed_trades.back()}));
+    CHECK(replayed_trades.back().id == 1);
+    CHECK(replayed.total_orders() == live.total_orders());
+    CHECK(replayed.state_hash() == live.state_hash());
+
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("journal replay stops at a torn tail record") {
+    const auto path = (std::filesystem::temp_directory_path() / "order_book_journal_torn.bin").string();
+    std::filesystem::remove(path);
+    {
+        Journal journal(path);
+        OrderBook book;
+        book.attach_journal(&journal);
+        book.add_order(make_typed(1, Side::Bid, 100, 10, OrderType::Limit));
+        book.add_order(make_typed(2, Side::Bid, 101, 10, OrderType::Limit));
+    }
+    std::filesystem::resize_file(path, std::filesystem::file_size(path) - 7);
+
+    OrderBook replayed;
+    CHECK(Journal::replay(path, replayed) == 1);
+    CHECK(replayed.best_bid()->id == 1);
+
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("journal reopened after a torn tail keeps later records replayable") {
+    const auto path = (std::filesystem::temp_directory_path() / "order_book_journal_reopen.bin").string();
+    std::filesystem::remove(path);
+
+    OrderBook live;
+    {
+        Journal journal(path);
+        live.attach_journal(&journal);
+        live.add_order(make_typed(1, Side::Bid, 100, 10, OrderType::Limit));
+        live.add_order(make_typed(2, Side::Bid, 101, 10, OrderType::Limit));
+        live.attach_journal(nullptr);
+    }
+    std::filesystem::resize_file(path, std::filesystem::file_size(path) - 7);
+
+    // Crash recovery: rebuild from the intact prefix, then keep journaling to the same file.
+    OrderBook recovered;
+    REQUIRE(Journal::replay(path, recovered) == 1);
+    {
+        Journal journal(path);
+        recovered.attach_journal(&journal);
+        recovered.add_order(make_typed(3, Side::Bid, 102, 10, OrderType::Limit));
+        recovered.add_order(make_typed(4, Side::Ask, 110, 10, OrderType::Limit));
+        recovered.attach_journal(nullptr);
+    }
+
+    OrderBook replayed;
+    CHECK(Journal::replay(path, replayed) == 3);
+    CHECK(replayed.total_orders() == recovered.total_orders());
+    CHECK(replayed.state_hash() == recovered.state_hash());
+
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("journal flushes a partial batch once max_delay passes") {
+    const auto path = (std::filesystem::temp_directory_path() / "order_book_journal_delay.bin").string();
+    std::filesystem::remove(path);
+    {
+        Journal journal(path, Journal::Options{.batch_records = 1024, .max_delay = std::chrono::milliseconds(1)});
+        OrderBook book;
+        book.attach_journal(&journal);
+        book.add_order(make_typed(1, Side::Bid, 100, 10, OrderType::Limit));
+
+        // No commit and far from a full batch: the record must still reach the file.
+        bool written = false;
+        for (int i = 0; i < 2000 && !written; ++i) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            OrderBook probe;
+            written = Journal::replay(path, probe) == 1;
+        }
+        CHECK(written);
+        book.attach_journal(nullptr);
+    }
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("journal write failure stops commands instead of dropping them") {
+    const auto path = (std::filesystem::temp_directory_path() / "order_book_journal_efbig.bin").string();
+    std::filesystem::remove(path);
+
+    // Cap the file size so a batch write fails with EFBIG, as it would on a full disk.
+    rlimit saved{};
+    getrlimit(RLIMIT_FSIZE, &saved);
+    auto old_handler = std::signal(SIGXFSZ, SIG_IGN);
+    rlimit cap = saved;
+    cap.rlim_cur = 4096;
+    setrlimit(RLIMIT_FSIZE, &cap);
+
+    OrderBook book;
+    bool threw = false;
+    {
+        Journal journal(path, Journal::Options{.batch_records = 16});
+        book.attach_journal(&journal);
+        try {
+            for (std::uint64_t id = 1; id <= 10'000; ++id)
+                book.add_order(make_typed(id, Side::Bid, 100, 1, OrderType::Limit));
+        } catch (const std::system_error&) {
+            threw = true;
+        }
+        CHECK_FALSE(journal.healthy());
+        book.attach_journal(nullptr);
+    }
+
+    setrlimit(RLIMIT_FSIZE, &saved);
+    std::signal(SIGXFSZ, old_handler);
+
+    CHECK(threw);
+    CHECK(book.total_orders() < 10'000);                  // the rejected command was not applied
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("journal refuses to attach to a book it could not rebuild") {
+    const auto path = (std::filesystem::temp_directory_path() / "order_book_journal_attach.bin").string();
+    std::filesystem::remove(path);
+    {
+        Journal journal(path);
+        OrderBook book;
+        book.add_order(make_typed(1, Side::Bid, 100, 10, OrderType::Limit));
+        CHECK_THROWS_AS(book.attach_journal(&journal), std::logic_error);
+
+        book.clear();                                    // fresh again
+        book.attach_journal(&journal);
+        book.add_order(make_typed(2, Side::Bid, 100, 10, OrderType::Limit));
+        book.attach_journal(nullptr);
+    }
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("state hash – same state via different paths matches") {
+    OrderBook direct;
+    direct.add_order(make_typed(1, Side::Bid, 100, 5, OrderType::Limit));
+    direct.add_order(make_typed(4, Side::Bid, 100, 8, OrderType::Limit));
+    direct.add_order(make_typed(2, Side::Ask, 105, 7, OrderType::Limit));
+
+    OrderBook indirect;
+    indirect.add_order(make_typed(1, Side::Bid, 100, 20, OrderType::Limit));
+    indirect.add_order(make_typed(9, Side::Bid, 100, 3, OrderType::Limit));   // rests between 1 and 4 ...
+    indirect.add_order(make_typed(4, Side::Bid, 100, 8, OrderType::Limit));
+    indirect.add_order(make_typed(2, Side::Ask, 105, 10, OrderType::Limit));
+    indirect.cancel_order(9);                                                  // ... and leaves again
+    indirect.decrease_qty(1, 10);
+    indirect.add_order(make_typed(3, Side::Ask, 100, 5, OrderType::IOC));   // fills 5 of id 1
+    indirect.modify_order(2, 106, 10);                                       // re-priced away ...
+    indirect.modify_order(2, 105, 7);                                        // ... and back
+
+    CHECK(indirect.state_hash() == direct.state_hash());
+}
+
+TEST_CASE("state hash – does not depend on orders that came and went") {
+    OrderBook a;
+    a.add_order(make_typed(1, Side::Bid, 100, 10, OrderType::Limit));
+    a.add_order(make_typed(2, Side::Bid, 100, 10, OrderType::Limit));
+
+    OrderBook b;
+    b.add_order(make_typed(9, Side::Bid, 100, 10, OrderType::Limit));
+    b.cancel_order(9);
+    b.add_order(make_typed(1, Side::Bid, 100, 10, OrderType::Limit));
+    b.add_order(make_typed(2, Side::Bid, 100, 10, OrderType::Limit));
+
+    CHECK(b.state_hash() == a.state_hash());
+}
+
+TEST_CASE("state hash – qty, price and priority all matter") {
+    OrderBook a;
+    a.add_order(make_typed(1, Side::Bid, 100, 10, OrderType::Limit));
+    a.add_order(make_typed(2, Side::Bid, 100, 10, OrderType::Limit));
+
+    OrderBook swapped;                                   // same orders, other FIFO order
+    swapped.add_order(make_typed(2, Side::Bid, 100, 10, OrderType::Limit));
+    swapped.add_order(make_typed(1, Side::Bid, 100, 10, OrderType::Limit));
+    CHECK(swapped.state_hash() != a.state_hash());
+
+    OrderBook qty;
+    qty.add_order(make_typed(1, Side::Bid, 100, 10, OrderType::Limit));
+    qty.add_order(make_typed(2, Side::Bid, 100, 11, OrderType::Limit));
+    CHECK(qty.state_hash() != a.state_hash());
+
+    OrderBook side;
+    side.add_order(make_typed(1, Side::Ask, 100, 10, OrderType::Limit));
+    side.add_order(make_typed(2, Side::Ask, 100, 10, OrderType::Limit));
+    CHECK(side.state_hash() != a.state_hash());
+}
+
+TEST_CASE("state hash – empty book hashes to zero") {
+    OrderBook book;
+    CHECK(book.state_hash() == 0);
+    book.add_order(make_typed(1, Side::Bid, 100, 10, OrderType::Limit));
+    book.add_order(make_typed(2, Side::Ask, 101, 10, OrderType::Limit));
+    CHECK(book.state_hash() != 0);
+
+    book.cancel_order(1);
+    book.modify_order(2, 99, std::nullopt);              // re-priced, stays an ask
+    book.cancel_order(2);
+    CHECK(book.state_hash() == 0);
+}